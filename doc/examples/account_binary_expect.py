@@ -0,0 +1,34 @@
+import struct
+import subprocess
+import sys
+
+# Drives the account example with protocol=binary. The actions are
+# numbered in alphabetical order of their names, so deposit is 0,
+# get_balance is 1 and withdraw is 2.
+
+def frame(*vals):
+    payload = b''.join(struct.pack('>q',v) for v in vals)
+    return struct.pack('>I',len(payload)) + payload
+
+def parse(data):
+    frames = []
+    while data:
+        n = struct.unpack('>I',data[:4])[0]
+        payload = data[4:4+n]
+        data = data[4+n:]
+        frames.append([struct.unpack('>q',payload[i:i+8])[0] for i in range(0,len(payload),8)])
+    return frames
+
+def run(name,opts,res):
+    cmds = (frame(1) + frame(0,5) + frame(1) + frame(2,2) + frame(1)
+            + frame(7)              # no such action
+            + frame(0,70000)        # out of range for bv[16]
+            + frame(0)              # missing parameter
+            + frame(2,4) + frame(1))
+    expected = [[0,0],[0],[0,5],[0],[0,3],[1],[1],[1],[0],[0,65535]]
+    child = subprocess.Popen(['./{}'.format(name),'protocol=binary'],
+                             stdin=subprocess.PIPE,stdout=subprocess.PIPE)
+    out,err = child.communicate(cmds)
+    got = parse(out)
+    print got
+    return got == expected
@@ -0,0 +1,53 @@
+import os
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+# Drives the helloworld example with protocol=binary over a Unix
+# domain socket. The call to the imported action world comes back as
+# a frame holding 2 and the import's number, before the reply to hello.
+
+def frame(*vals):
+    payload = b''.join(struct.pack('>q',v) for v in vals)
+    return struct.pack('>I',len(payload)) + payload
+
+def parse(data):
+    frames = []
+    while data:
+        n = struct.unpack('>I',data[:4])[0]
+        payload = data[4:4+n]
+        data = data[4+n:]
+        frames.append([struct.unpack('>q',payload[i:i+8])[0] for i in range(0,len(payload),8)])
+    return frames
+
+def run(name,opts,res):
+    path = os.path.abspath('build/{}.sock'.format(os.path.basename(name)))
+    if os.path.exists(path):
+        os.unlink(path)
+    child = subprocess.Popen(['./{}'.format(name),'protocol=binary','socket='+path])
+    sock = socket.socket(socket.AF_UNIX,socket.SOCK_STREAM)
+    for i in range(100):
+        try:
+            sock.connect(path)
+            break
+        except socket.error:
+            time.sleep(0.1)
+    else:
+        child.kill()
+        print 'cannot connect to {}'.format(path)
+        return False
+    sock.sendall(frame(0) + frame(0))
+    sock.shutdown(socket.SHUT_WR)
+    data = b''
+    while True:
+        chunk = sock.recv(4096)
+        if not chunk:
+            break
+        data += chunk
+    sock.close()
+    child.wait()
+    got = parse(data)
+    print got
+    return got == [[2,0],[0],[2,0],[0]]
@@ -15,9 +15,18 @@ import ivy_theory as thy
 import ivy_ast
 import ivy_proof
 import ivy_trace
+import ivy_solver as slv
+
+import time
+import z3
+
+opt_incremental = iu.BooleanParameter("incremental_bmc",False)
 
 def check_isolate(n_steps):
-    
+    if opt_incremental.get():
+        check_isolate_incremental(n_steps)
+        return
+
     step_action = ia.env_action(None)
 
     conjectures = im.module.conjs
@@ -48,4 +57,69 @@ def check_isolate(n_steps):
             print res
             exit(0)
         post = ag.execute(step_action)
-            
+
+# Incremental BMC. Instead of rebuilding and solving the history for
+# each depth, we keep one solver and unroll the step action into it one
+# copy at a time. The state symbols updated by the step get one copy
+# per depth, named '__<k>_<name>', and the skolems of the step get one
+# copy per step. The negated invariant at depth k is added under an
+# assumption literal, so it holds only in the check at depth k. When a
+# counterexample is found, the usual history at that depth is solved
+# once more to print the trace.
+
+def check_isolate_incremental(n_steps):
+
+    step_action = ia.env_action(None)
+
+    conjectures = im.module.conjs
+    conj = ilu.and_clauses(*conjectures)
+
+    used_names = frozenset(x.name for x in il.sig.symbols.values())
+    def witness(v):
+        c = lg.Const('@' + v.name, v.sort)
+        assert c.name not in used_names
+        return c
+    clauses = ilu.dual_clauses(conj, witness)
+
+    ag = art.AnalysisGraph()
+    with ag.context as ac:
+        ag.add_initial_state(ag.init_cond)
+        post = ag.states[0]
+    if 'initialize' in im.module.actions:
+        init_action = im.module.actions['initialize']
+        post = ag.execute(init_action, None, None, 'initialize')
+    init = ag.get_history(post).post
+    updated,trans,_ = step_action.update(post.domain,post.in_scope)
+    axioms = im.module.background_theory()
+
+    def frame(k):
+        return dict((sym,sym.prefix('__{}_'.format(k))) for sym in updated)
+
+    def step(k):
+        rn = dict((tr.new(sym),sym.prefix('__{}_'.format(k+1))) for sym in updated)
+        rn.update(frame(k))
+        for sym in ilu.used_symbols_clauses(trans):
+            if tr.is_skolem(sym) and not tr.is_global_skolem(sym) and sym not in rn:
+                rn[sym] = sym.prefix('__s{}_'.format(k))
+        return ilu.rename_clauses(trans,rn)
+
+    s = z3.Solver()
+    s.add(slv.clauses_to_z3(ilu.rename_clauses(ilu.and_clauses(init,axioms),frame(0))))
+    for n in range(n_steps + 1):
+        print 'Checking invariants at depth {}...'.format(n),
+        start = time.time()
+        if n > 0:
+            s.add(slv.clauses_to_z3(step(n-1)))
+            s.add(slv.clauses_to_z3(ilu.rename_clauses(axioms,frame(n))))
+        lit = z3.Bool('__bmc_bad_{}'.format(n))
+        s.add(z3.Implies(lit,slv.clauses_to_z3(ilu.rename_clauses(clauses,frame(n)))))
+        res = slv.decide(s,[lit])
+        print '{:.2f}s'.format(time.time() - start)
+        if res == z3.sat:
+            for k in range(n):
+                post = ag.execute(step_action)
+            res = ivy_trace.check_final_cond(ag,post,clauses,[],True)
+            print 'BMC with bound {} found a counter-example...'.format(n)
+            print
+            print res
+            exit(0)
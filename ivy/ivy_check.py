@@ -29,6 +29,8 @@ import ivy_bmc
 import ivy_tactics
 
 import sys
+import multiprocessing
+import StringIO
 from collections import defaultdict
 
 diagnose = iu.BooleanParameter("diagnose",False)
@@ -38,6 +40,7 @@ opt_trusted = iu.BooleanParameter("trusted",False)
 opt_mc = iu.BooleanParameter("mc",False)
 opt_trace = iu.BooleanParameter("trace",False)
 opt_separate = iu.BooleanParameter("separate",None)
+opt_jobs = iu.Parameter("jobs","1")
 
 def display_cex(msg,ag):
     if diagnose.get():
@@ -320,7 +323,6 @@ def check_fcs_in_state(mod,ag,post,fcs):
 #    iu.dbg('"foo"')
     history = ag.get_history(post)
 #    iu.dbg('history.actions')
-    gmc = lambda cls, final_cond: itr.small_model_clauses(cls,final_cond,shrink=diagnose.get())
     axioms = im.module.background_theory()
     if opt_trace.get() or diagnose.get():
         clauses = history.post
@@ -354,9 +356,9 @@ def check_fcs_in_state(mod,ag,post,fcs):
                 print str(handler)
             exit(0)
     else:
-        res = history.satisfy(axioms,gmc,filter_fcs(fcs))
-        if res is not None and diagnose.get():
-            show_counterexample(ag,post,res)
+        # Only the verdicts are wanted here, so no model is built.
+        clauses = lut.and_clauses(history.post,axioms)
+        itr.small_model_clauses(clauses,filter_fcs(fcs),shrink=False,need_model=False)
     return not any(fc.failed for fc in fcs)
 
 def check_conjs_in_state(mod,ag,post,indent=8):
@@ -507,19 +509,16 @@ def check_isolate():
 
         if checked_actions and mod.labeled_conjs:
             print "\n    The following set of external actions must preserve the invariant:"
-            for actname in sorted(checked_actions):
-                action = act.env_action(actname)
-                print "        {}{}".format(pretty_lineno(action),actname)
-                if check:
-                    ag = ivy_art.AnalysisGraph()
-                    pre = itp.State()
-                    pre.clauses = get_conjs(mod)
-                    with itp.EvalContext(check=False): # don't check safety
-    #                    post = ag.execute(action, pre, None, actname)
-                        post = ag.execute(action, pre)
-                    check_conjs_in_state(mod,ag,post,indent=12)
-                else:
-                    print ''
+            if check and can_run_jobs() and len(checked_actions) > 1:
+                run_jobs(check_action_preserves_invariant,sorted(checked_actions))
+            else:
+                for actname in sorted(checked_actions):
+                    if check:
+                        check_action_preserves_invariant(actname)
+                    else:
+                        action = act.env_action(actname)
+                        print "        {}{}".format(pretty_lineno(action),actname)
+                        print ''
 
 
 
@@ -593,6 +592,18 @@ def check_isolate():
 
 
 
+def check_action_preserves_invariant(actname):
+    mod = im.module
+    action = act.env_action(actname)
+    print "        {}{}".format(pretty_lineno(action),actname)
+    ag = ivy_art.AnalysisGraph()
+    pre = itp.State()
+    pre.clauses = get_conjs(mod)
+    with itp.EvalContext(check=False): # don't check safety
+#        post = ag.execute(action, pre, None, actname)
+        post = ag.execute(action, pre)
+    check_conjs_in_state(mod,ag,post,indent=12)
+
 # This is a little bit backward. When faced with a subgoal from the prover,
 # we check it by constructing fake isolate.
                 
@@ -716,38 +727,11 @@ def check_module():
     if missing:
         raise iu.IvyError(None,"Some assertions are not checked")
 
-    for isolate in isolates:
-        if isolate is not None and isolate in im.module.isolates:
-            idef = im.module.isolates[isolate]
-            if len(idef.verified()) == 0 or isinstance(idef,ivy_ast.TrustedIsolateDef):
-                continue # skip if nothing to verify
-        if isolate:
-            print "\nIsolate {}:".format(isolate)
-        if isolate is not None and iu.compose_names(isolate,'macro_finder') in im.module.attributes:
-            save_macro_finder = islv.opt_macro_finder.get()
-            if save_macro_finder:
-                print "Turning off macro_finder"
-                islv.set_macro_finder(False)
-        with im.module.copy():
-            ivy_isolate.create_isolate(isolate) # ,ext='ext'
-            if opt_trusted.get():
-                continue
-            method_name = get_isolate_method(isolate)
-            if method_name == 'mc':
-                mc_isolate(isolate)
-            elif method_name.startswith('bmc['):
-                global some_bounded
-                some_bounded = True
-                _,prms = iu.parse_int_subscripts(method_name)
-                if len(prms) != 1:
-                    raise IvyError(None,'BMC method specifier should be bmc[<steps>]. Got "{}".'.format(method_name))
-                mc_isolate(isolate,lambda : ivy_bmc.check_isolate(prms[0]))
-            else:
-                check_isolate()
-        if isolate is not None and iu.compose_names(isolate,'macro_finder') in im.module.attributes:
-            if save_macro_finder:
-                print "Turning on macro_finder"
-                islv.set_macro_finder(True)
+    if can_run_jobs() and len(isolates) > 1:
+        run_jobs(check_one_isolate,isolates)
+    else:
+        for isolate in isolates:
+            check_one_isolate(isolate)
     print ''
     if failures > 0:
         raise iu.IvyError(None,"failed checks: {}".format(failures))
@@ -756,6 +740,95 @@ def check_module():
 
     cact = checked_action.get()
 
+def check_one_isolate(isolate):
+    if isolate is not None and isolate in im.module.isolates:
+        idef = im.module.isolates[isolate]
+        if len(idef.verified()) == 0 or isinstance(idef,ivy_ast.TrustedIsolateDef):
+            return # skip if nothing to verify
+    if isolate:
+        print "\nIsolate {}:".format(isolate)
+    if isolate is not None and iu.compose_names(isolate,'macro_finder') in im.module.attributes:
+        save_macro_finder = islv.opt_macro_finder.get()
+        if save_macro_finder:
+            print "Turning off macro_finder"
+            islv.set_macro_finder(False)
+    with im.module.copy():
+        ivy_isolate.create_isolate(isolate) # ,ext='ext'
+        if opt_trusted.get():
+            return
+        method_name = get_isolate_method(isolate)
+        if method_name == 'mc':
+            mc_isolate(isolate)
+        elif method_name.startswith('bmc['):
+            global some_bounded
+            some_bounded = True
+            _,prms = iu.parse_int_subscripts(method_name)
+            if len(prms) != 1:
+                raise IvyError(None,'BMC method specifier should be bmc[<steps>]. Got "{}".'.format(method_name))
+            mc_isolate(isolate,lambda : ivy_bmc.check_isolate(prms[0]))
+        else:
+            check_isolate()
+    if isolate is not None and iu.compose_names(isolate,'macro_finder') in im.module.attributes:
+        if save_macro_finder:
+            print "Turning on macro_finder"
+            islv.set_macro_finder(True)
+
+# With option jobs=N, independent checks are run by a pool of N worker
+# processes. If there are several isolates, each job checks one
+# isolate. Otherwise, each job checks that one exported action
+# preserves the invariant. The workers are forked after the module is
+# parsed and type checked (and for actions, after the isolate is
+# created), so each one starts from a copy of it. A job returns its
+# output and its contribution to the global results. These are merged
+# in the order of the jobs, so the output is the same as for a
+# sequential run. Pool workers cannot fork pools of their own, so jobs
+# are not nested. Counterexamples need the terminal, so with diagnose
+# or trace, checks are sequential.
+
+in_job = False
+
+def can_run_jobs():
+    return (int(opt_jobs.get()) > 1 and not in_job
+            and not diagnose.get() and not opt_trace.get())
+
+def run_job(job):
+    global failures, some_bounded, checked_action_found, in_job
+    fun,arg = job
+    failures = 0
+    some_bounded = False
+    checked_action_found = False
+    in_job = True
+    out = StringIO.StringIO()
+    old_stdout = sys.stdout
+    sys.stdout = out
+    err = None
+    try:
+        fun(arg)
+    except iu.IvyError as e:
+        err = (e.lineno,e.msg)
+    finally:
+        sys.stdout = old_stdout
+    return out.getvalue(),failures,some_bounded,checked_action_found,err
+
+def run_jobs(fun,args):
+    global failures, some_bounded, checked_action_found
+    sys.stdout.flush()
+    pool = multiprocessing.Pool(min(int(opt_jobs.get()),len(args)))
+    try:
+        results = pool.map(run_job,[(fun,arg) for arg in args],chunksize=1)
+    finally:
+        pool.close()
+        pool.join()
+    for out,fails,bounded,found,err in results:
+        sys.stdout.write(out)
+        failures += fails
+        some_bounded = some_bounded or bounded
+        checked_action_found = checked_action_found or found
+        if err is not None:
+            e = iu.IvyError(None,err[1])
+            e.lineno = err[0]
+            raise e
+
 
 def main():
     import signal
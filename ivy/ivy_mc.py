@@ -20,6 +20,10 @@ import subprocess
 from collections import defaultdict
 import itertools
 import sys
+import os
+import re
+import time
+import hashlib
 
 logfile = None
 
@@ -1585,56 +1589,45 @@ class ModelChecker(object):
     pass
 
 class ABCModelChecker(ModelChecker):
+    # ABC commands for the engines we can use. The pdr and int engines
+    # can prove the property, while bmc can only find counterexamples.
+    engines = {'pdr':'pdr', 'bmc':'bmc3', 'int':'int'}
+    def __init__(self,engine='pdr'):
+        if engine not in self.engines:
+            raise iu.IvyError(None,'unknown model checking engine "{}" (choices are {})'
+                              .format(engine,','.join(sorted(self.engines))))
+        self.engine = engine
     def cmd(self,aigfilename,outfilename):
-        return ['abc','-c','read_aiger {}; pdr; write_aiger_cex  {}'.format(aigfilename,outfilename)]
+        return ['abc','-c','read_aiger {}; {}; write_aiger_cex  {}'.format(aigfilename,self.engines[self.engine],outfilename)]
+    # A counterexample is reported as "Output N of miter ... was
+    # asserted in frame K". When bmc gives up, it reports "No output
+    # asserted in K frames", which is not conclusive.
+    cex_re = re.compile(r'Output \d+ of miter .* was asserted in frame \d+')
     def scrape(self,alltext):
         return 'Property proved' in alltext
+    def conclusive(self,alltext):
+        return self.scrape(alltext) or self.cex_re.search(alltext) is not None
 
+# With option mc_engines=e1,e2,..., the engines are run at the same time
+# on the same AIG, and the first conclusive answer is taken. With
+# option mc_cache=<dir>, the AIG and the answer (with the witness, if
+# any) are stored in a subdirectory of <dir> named by a hash of the
+# AIG, so checking an unchanged model does not run the model checker.
+# The model is still encoded as an AIG on each check, since the AIG is
+# the cache key.
 
-def check_isolate():
-    
-    print
-    print 80*'*'
-    print
-
-    global logfile,logfile_name
-    if logfile is None:
-        logfile_name = 'ivy_mc.log'
-        logfile = open(logfile_name,'w')
-
-    mod = im.module
-
-    # build up a single action that does both initialization and all external actions
-
-    ext_acts = [mod.actions[x] for x in sorted(mod.public_actions)]
-    ext_act = ia.EnvAction(*ext_acts)
-    
-    # convert to aiger
-
-    aiger,decoder,annot,cnsts,action,stvarset = to_aiger(mod,ext_act)
-#    print aiger
-
-    # output aiger to temp file
+opt_mc_engines = iu.Parameter("mc_engines","pdr")
+opt_mc_cache = iu.Parameter("mc_cache","")
 
-    with tempfile.NamedTemporaryFile(suffix='.aag',delete=False) as f:
-        name = f.name
-#        print 'file name: {}'.format(name)
-        f.write(str(aiger))
-    
-    # convert aag to aig format
-
-    aigfilename = name.replace('.aag','.aig')
+def aag_to_aig(aagfilename,aigfilename):
     try:
-        ret = subprocess.call(['aigtoaig',name,aigfilename])
+        ret = subprocess.call(['aigtoaig',aagfilename,aigfilename])
     except:
         raise iu.IvyError(None,'failed to run aigtoaig')
     if ret != 0:
         raise iu.IvyError(None,'aigtoaig returned non-zero status')
-        
-    # run model checker
 
-    outfilename = name.replace('.aag','.out')
-    mc = ABCModelChecker() # TODO: make a command-line option
+def run_model_checker(mc,aigfilename,outfilename):
     cmd = mc.cmd(aigfilename,outfilename)
 #    print cmd
     try:
@@ -1661,10 +1654,167 @@ def check_isolate():
     ret = p.wait()
     if ret != 0:
         raise iu.IvyError(None,'model checker returned non-zero status')
+    if not mc.conclusive(alltext):
+        raise iu.IvyError(None,'model checking engine {} gave no conclusive result'.format(mc.engine))
+    return mc.scrape(alltext)
+
+# Write a file in the model checking cache. Since several processes can
+# share the cache (see option jobs), the file is written under a
+# temporary name and then renamed.
+
+def write_cache_file(filename,text):
+    tmp = '{}.{}'.format(filename,os.getpid())
+    with open(tmp,'w') as f:
+        f.write(text)
+    os.rename(tmp,filename)
+
+# Run several model checkers concurrently. Each one writes its output
+# to a file, so that none of them blocks on a full pipe. Returns whether
+# the property was proved, and the witness file name.
+
+def run_model_checkers(mcs,aigfilename,basename):
+    procs = []
+    for mc in mcs:
+        outfilename = '{}.{}.out'.format(basename,mc.engine)
+        logfilename = '{}.{}.log'.format(basename,mc.engine)
+        with open(logfilename,'w') as log:
+            try:
+                p = subprocess.Popen(mc.cmd(aigfilename,outfilename),stdout=log,stderr=subprocess.STDOUT)
+            except:
+                raise iu.IvyError(None,'failed to run model checker')
+        procs.append((mc,p,outfilename,logfilename))
+    winner = None
+    try:
+        running = list(procs)
+        while running and winner is None:
+            time.sleep(0.05)
+            for job in list(running):
+                mc,p,outfilename,logfilename = job
+                if p.poll() is None:
+                    continue
+                running.remove(job)
+                with open(logfilename) as log:
+                    alltext = log.read()
+                if p.returncode == 0 and mc.conclusive(alltext):
+                    winner = (mc,outfilename,alltext)
+                    break
+    finally:
+        for mc,p,outfilename,logfilename in procs:
+            if p.poll() is None:
+                p.kill()
+                p.wait()
+            if os.path.exists(logfilename):
+                os.remove(logfilename)
+            if (winner is None or outfilename != winner[1]) and os.path.exists(outfilename):
+                os.remove(outfilename)
+    if winner is None:
+        raise iu.IvyError(None,'no model checking engine gave a conclusive result ({})'
+                          .format(','.join(mc.engine for mc in mcs)))
+    mc,outfilename,alltext = winner
+    print '\nModel checker output ({}):'.format(mc.engine)
+    print 80*'-'
+    sys.stdout.write(alltext)
+    print 80*'-'
+    return mc.scrape(alltext),outfilename
+
+# Model check an AIG given in aag format with engines mcs. Returns
+# whether the property was proved, and if not, the name of the witness
+# file.
+
+def model_check_aiger(aag,mcs):
+
+    # output aiger to a temp file, or find it in the cache
+
+    cachedir = None
+    if opt_mc_cache.get():
+        cachedir = os.path.join(opt_mc_cache.get(),hashlib.sha1(aag).hexdigest())
+        if not os.path.isdir(cachedir):
+            try:
+                os.makedirs(cachedir)
+            except OSError:
+                if not os.path.isdir(cachedir):
+                    raise
+        name = os.path.join(cachedir,'model.aag')
+        if not os.path.exists(name):
+            write_cache_file(name,aag)
+    else:
+        with tempfile.NamedTemporaryFile(suffix='.aag',delete=False) as f:
+            name = f.name
+#            print 'file name: {}'.format(name)
+            f.write(aag)
+    
+    # convert aag to aig format. In the cache, outputs are written
+    # under names private to this process, then renamed. The format of
+    # an aigtoaig output file is given by its suffix, so the suffix is
+    # kept.
+
+    basename = name.replace('.aag','')
+    if cachedir is not None:
+        basename = '{}.{}'.format(basename,os.getpid())
+    aigfilename = name.replace('.aag','.aig')
+    if cachedir is None:
+        aag_to_aig(name,aigfilename)
+    elif not os.path.exists(aigfilename):
+        aag_to_aig(name,basename + '.aig')
+        os.rename(basename + '.aig',aigfilename)
+        
+    # run model checker, unless the answer is cached. Only conclusive
+    # answers get here, so only those are stored.
+
+    outfilename = name.replace('.aag','.out')
+    resultfilename = name.replace('.aag','.result')
+    if cachedir is not None and os.path.exists(resultfilename):
+        with open(resultfilename) as f:
+            proved = f.read().strip() == 'proved'
+        print '\nModel checker result read from {}'.format(cachedir)
+    else:
+        if len(mcs) == 1:
+            witness = basename + '.out'
+            proved = run_model_checker(mcs[0],aigfilename,witness)
+        else:
+            proved,witness = run_model_checkers(mcs,aigfilename,basename)
+        if not proved and witness != outfilename:
+            os.rename(witness,outfilename)
+        if cachedir is not None:
+            write_cache_file(resultfilename,'proved\n' if proved else 'failed\n')
+    return proved,outfilename
+
+def check_isolate():
+    
+    print
+    print 80*'*'
+    print
+
+    global logfile,logfile_name
+    if logfile is None:
+        logfile_name = 'ivy_mc.log'
+        logfile = open(logfile_name,'w')
+
+    mod = im.module
+
+    # build up a single action that does both initialization and all external actions
+
+    ext_acts = [mod.actions[x] for x in sorted(mod.public_actions)]
+    ext_act = ia.EnvAction(*ext_acts)
+    
+    # convert to aiger
+
+    aiger,decoder,annot,cnsts,action,stvarset = to_aiger(mod,ext_act)
+#    print aiger
+
+    engines = []
+    for e in opt_mc_engines.get().split(','):
+        if e.strip() and e.strip() not in engines:
+            engines.append(e.strip())
+    mcs = [ABCModelChecker(e) for e in engines]
+    if not mcs:
+        raise iu.IvyError(None,'no model checking engine given')
+
+    proved,outfilename = model_check_aiger(str(aiger),mcs)
 
     # scrape the output to get the answer
 
-    if mc.scrape(alltext):
+    if proved:
         print '\nPASS'
     else:
         print '\nFAIL'
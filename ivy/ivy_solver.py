@@ -10,6 +10,10 @@ from itertools import chain
 from collections import defaultdict
 import re
 import functools
+import hashlib
+import os
+import select
+import signal
 
 import z3
 import ivy_logic
@@ -38,11 +42,18 @@ def set_seed(seed):
 opt_seed = iu.Parameter("seed",0,process=int)
 opt_seed.set_callback(set_seed)
 
+macro_finder = True
+
 def set_macro_finder(truth):
+    global macro_finder
+    macro_finder = truth
     z3.set_param('smt.macro_finder',truth)
     
 opt_incremental = iu.BooleanParameter("incremental",True)
 opt_show_vcs = iu.BooleanParameter("show_vcs",False)
+opt_vc_cache = iu.Parameter("vc_cache","")
+opt_portfolio = iu.Parameter("portfolio","1")
+opt_recheck = iu.BooleanParameter("recheck",False)
 
 #z3.set_param('smt.mbqi.trace',True)
 opt_macro_finder = iu.BooleanParameter("macro_finder",True)
@@ -1035,19 +1046,125 @@ def model_if_none(clauses1,implied,model):
     return h
 
 
+# With option portfolio=N, each query is raced in N forked processes,
+# each with a different random seed, and the first conclusive answer is
+# taken. Since a child cannot hand its model back, a sat answer is
+# recomputed in this process with the winning seed.
+#
+# The seed is set on the solver itself. Changing the global parameter
+# smt.random_seed has no effect on a solver that has already been
+# checked, so every child would run the same search.
+
+def set_solver_seed(s,seed):
+    s.set('random_seed',seed)
+
+def portfolio_check(s,atoms,n):
+    base = opt_seed.get()
+    children = []
+    for idx in range(n):
+        r,w = os.pipe()
+        pid = os.fork()
+        if pid == 0:
+            os.close(r)
+            try:
+                set_solver_seed(s,base + idx)
+                res = s.check() if atoms == None else s.check(atoms)
+                os.write(w,'unsat' if res == z3.unsat else 'sat' if res == z3.sat else 'unknown')
+            finally:
+                os._exit(0)
+        os.close(w)
+        children.append((pid,r,idx))
+    res,seed = z3.unknown,base
+    try:
+        pending = dict((r,(pid,idx)) for pid,r,idx in children)
+        while pending:
+            ready,_,_ = select.select(list(pending),[],[])
+            for r in ready:
+                pid,idx = pending.pop(r)
+                ans = os.read(r,16)
+                if ans in ['sat','unsat']:
+                    res,seed = (z3.sat if ans == 'sat' else z3.unsat),base + idx
+                    pending = dict()
+                    break
+    finally:
+        for pid,r,idx in children:
+            try:
+                os.kill(pid,signal.SIGKILL)
+            except OSError:
+                pass
+            os.waitpid(pid,0)
+            os.close(r)
+    if res == z3.sat:
+        set_solver_seed(s,seed)
+        res = s.check() if atoms == None else s.check(atoms)
+        set_solver_seed(s,base)
+    return res
+
 def decide(s,atoms=None):
 #    print "solving{"
 #    f = open("ivy.smt2","w")
 #    f.write(s.to_smt2())
 #    f.close()
-    res = s.check() if atoms == None else s.check(atoms)
+    n = int(opt_portfolio.get())
+    if n > 1:
+        res = portfolio_check(s,atoms,n)
+    else:
+        res = s.check() if atoms == None else s.check(atoms)
     if res == z3.unknown:
         print s.to_smt2()
         raise iu.IvyError(None,"Solver produced inconclusive result")
 #    print "}"
     return res
 
-def get_small_model(clauses, sorts_to_minimize, relations_to_minimize, final_cond=None, shrink=True):
+# With option vc_cache=<dir>, the result of checking each final
+# condition in get_small_model is stored in directory <dir>, in a file
+# named by a hash of the query in SMT-LIB form, the z3 version and the
+# solver options. A later check of the same query, in this run or
+# another, reads the result instead of calling the solver. With option
+# recheck=true, stored results are ignored but new ones are still
+# stored.
+#
+# The options in the key are the z3 parameters that can change the
+# answer or whether one is found (vc_cache_z3_params), and the ivy
+# options that change how the query is posed or solved.
+
+vc_cache_z3_params = ['smt.random_seed','smt.macro_finder','smt.mbqi','smt.auto_config','smt.relevancy']
+
+def vc_cache_key(s):
+    h = hashlib.sha1()
+    h.update(z3.get_version_string())
+    for param in vc_cache_z3_params:
+        h.update(' {}={}'.format(param,z3.get_param(param)))
+    h.update(' seed={} macro_finder={} incremental={} portfolio={} z3_enums={}\n'.format(
+        opt_seed.get(),macro_finder,opt_incremental.get(),opt_portfolio.get(),use_z3_enums))
+    h.update(s.to_smt2())
+    return h.hexdigest()
+
+def vc_cache_lookup(key):
+    if opt_recheck.get():
+        return None
+    try:
+        with open(os.path.join(opt_vc_cache.get(),key)) as f:
+            res = f.read().strip()
+    except IOError:
+        return None
+    return z3.unsat if res == 'unsat' else z3.sat if res == 'sat' else None
+
+def vc_cache_store(key,res):
+    cache_dir = opt_vc_cache.get()
+    if not os.path.isdir(cache_dir):
+        try:
+            os.makedirs(cache_dir)
+        except OSError:
+            if not os.path.isdir(cache_dir):
+                raise
+    path = os.path.join(cache_dir,key)
+    tmp = '{}.{}'.format(path,os.getpid())
+    with open(tmp,'w') as f:
+        f.write('unsat\n' if res == z3.unsat else 'sat\n')
+    os.rename(tmp,path)
+
+def get_small_model(clauses, sorts_to_minimize, relations_to_minimize, final_cond=None, shrink=True, need_model=True):
     """
     Return a HerbrandModel with a "small" model of clauses.
 
@@ -1070,6 +1187,10 @@ def get_small_model(clauses, sorts_to_minimize, relations_to_minimize, final_con
         unsat() : called if unsat
         assume() : if returns true, assume rather than check
 
+    If need_model is false, the caller only wants to know whether the
+    clauses are satisfiable. True is then returned in place of a
+    model, and a result read from the vc_cache is not recomputed.
+
     """
 
     if opt_show_vcs.get():
@@ -1117,11 +1238,19 @@ def get_small_model(clauses, sorts_to_minimize, relations_to_minimize, final_con
                     the_fmla = clauses_to_z3(foo)
 #                    iu.dbg('the_fmla')
                     s.add(the_fmla)
-                    res = decide(s)
+                    key = vc_cache_key(s) if opt_vc_cache.get() else None
+                    res = vc_cache_lookup(key) if key is not None else None
+                    cached = res is not None
+                    if not cached:
+                        res = decide(s)
+                        if key is not None:
+                            vc_cache_store(key,res)
                     if res != z3.unsat:
                         if fc.sat():
                             res = z3.unsat
                         else:
+                            if cached and need_model:
+                                res = decide(s) # we need the model
                             break
                     else:
                         fc.unsat()
@@ -1134,6 +1263,8 @@ def get_small_model(clauses, sorts_to_minimize, relations_to_minimize, final_con
         res = decide(s)
     if res == z3.unsat:
         return None
+    if not need_model:
+        return True
 
     if shrink:
         print "searching for a small model...",
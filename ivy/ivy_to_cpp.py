@@ -210,6 +210,11 @@ def declare_ctuple(header,dom):
                   + ') : '+','.join('arg'+str(idx)+'(arg'+str(idx)+')' for idx,d in enumerate(dom))
                   + '{}\n')
     header.append("        size_t __hash() const { "+struct_hash_fun(['arg{}'.format(n) for n in range(len(dom))],dom) + "}\n")
+    header.append('        friend size_t __ivy_arg_hash(const ' + t + ' &x, int n) {\n')
+    header.append('            switch (n) {\n')
+    for idx,sort in enumerate(dom):
+        header.append('            case {}: return hash_space::hash<{}>()(x.arg{});\n'.format(idx,hashtype(sort),idx))
+    header.append('            }\n            return 0;\n        }\n')
     header.append('};\n')
 
 def ctuple_hash(dom):
@@ -236,28 +241,113 @@ def declare_hash_thunk(header):
 template <typename D, typename R>
 struct thunk {
     virtual R operator()(const D &) = 0;
+    // True if this thunk is the constant R().
+    virtual bool is_default() {return false;}
     int ___ivy_choose(int rng,const char *name,int id) {
         return 0;
     }
 };
+// The hash of argument n of a point. A tuple of arguments declares its
+// own version of this (see declare_ctuple).
+template <typename D>
+size_t __ivy_arg_hash(const D &arg, int n) {
+    return hash_space::hash<D>()(arg);
+}
+// A function stored as a thunk giving its default values and a memo of
+// the values that have been read or written. If the thunk is constant
+// R() (as for a relation that was set to false) the function is R()
+// outside the memo, so its other points can be enumerated from the memo.
 template <typename D, typename R, class HashFun = hash_space::hash<D> >
 struct hash_thunk {
+    typedef typename hash_space::hash_map<D,R,HashFun>::iterator iterator;
+    typedef hash_space::hash_set<D,HashFun> point_set;
     thunk<D,R> *fun;
     hash_space::hash_map<D,R,HashFun> memo;
-    hash_thunk() : fun(0) {}
-    hash_thunk(thunk<D,R> *fun) : fun(fun) {}
+    // The points of the memo where the value is not R(), and for each
+    // argument position that is looked up (see lookup), the same points
+    // by the hash of their argument at that position. Writes through set
+    // keep these up to date. A write through operator[] may change any
+    // point, so it drops them, and they are rebuilt when next needed.
+    point_set points;
+    std::vector<hash_space::hash_map<unsigned long long,point_set> > by_arg;
+    std::vector<bool> has_arg;
+    bool indexed;
+    bool sparse() {return !fun || fun->is_default();}
+    iterator begin() {return memo.begin();}
+    iterator end() {return memo.end();}
+    hash_thunk() : fun(0), indexed(true) {}
+    hash_thunk(thunk<D,R> *fun) : fun(fun), indexed(true) {}
     ~hash_thunk() {
 //        if (fun)
 //            delete fun;
     }
     R &operator[](const D& arg){
+        indexed = false;
         std::pair<typename hash_space::hash_map<D,R>::iterator,bool> foo = memo.insert(std::pair<D,R>(arg,R()));
         R &res = foo.first->second;
         if (foo.second && fun)
             res = (*fun)(arg);
         return res;
     }
+    // Reading a point outside the memo of a sparse function does not
+    // add it to the memo.
+    R get(const D& arg) {
+        iterator it = memo.find(arg);
+        if (it != memo.end())
+            return it->second;
+        return sparse() ? R() : (*this)[arg];
+    }
+    void set(const D& arg, const R &val) {
+        std::pair<iterator,bool> foo = memo.insert(std::pair<D,R>(arg,val));
+        if (!foo.second)
+            foo.first->second = val;
+        if (!indexed)
+            return;
+        if (val == R()) {
+            if (points.erase(arg))
+                for (unsigned n = 0; n < has_arg.size(); n++)
+                    if (has_arg[n])
+                        by_arg[n][__ivy_arg_hash(arg,n)].erase(arg);
+        }
+        else if (points.insert(arg).second)
+            for (unsigned n = 0; n < has_arg.size(); n++)
+                if (has_arg[n])
+                    by_arg[n][__ivy_arg_hash(arg,n)].insert(arg);
+    }
+    void reindex() {
+        if (indexed)
+            return;
+        points.clear();
+        for (iterator it = memo.begin(); it != memo.end(); ++it)
+            if (!(it->second == R()))
+                points.insert(it->first);
+        by_arg.clear();
+        has_arg.clear();
+        indexed = true;
+    }
+    // The points where the value is not R()
+    const point_set &nondefault() {
+        reindex();
+        return points;
+    }
+    // The points where the value is not R() and argument n has hash h
+    const point_set &lookup(int n, unsigned long long h) {
+        static point_set none;
+        reindex();
+        if (has_arg.size() <= (unsigned)n) {
+            has_arg.resize(n+1);
+            by_arg.resize(n+1);
+        }
+        if (!has_arg[n]) {
+            for (typename point_set::iterator it = points.begin(); it != points.end(); ++it)
+                by_arg[n][__ivy_arg_hash(*it,n)].insert(*it);
+            has_arg[n] = true;
+        }
+        typename hash_space::hash_map<unsigned long long,point_set>::iterator it = by_arg[n].find(h);
+        return it == by_arg[n].end() ? none : it->second;
+    }
 };
+void __ivy_cannot_enumerate(const char *name);
 """)        
 
 def all_members():
@@ -267,8 +357,8 @@ def all_members():
 
 def all_ctuples():
     done = set()
-    for sym in all_members():
-        if hasattr(sym.sort,'dom') and len(sym.sort.dom) > 1 and is_large_type(sym.sort):
+    for sym in list(all_members()) + sorted(memo_deps,key=lambda r: r.name):
+        if hasattr(sym.sort,'dom') and len(sym.sort.dom) > 1 and (is_large_type(sym.sort) or sym in memo_deps):
             res = tuple(sym.sort.dom)
             name = ctuple(res)
             if name in done:
@@ -477,6 +567,10 @@ def make_thunk(impl,vs,expr):
     expr = ilu.substitute_ast(expr,subst)
     code_line(impl,'return ' + code_eval(impl,expr))
     close_scope(impl)
+    if il.is_false(expr):
+        open_scope(impl,line='bool is_default()')
+        code_line(impl,'return true')
+        close_scope(impl)
     if target.get() in ["gen","test"]:
         open_scope(impl,line = 'z3::expr to_z3(gen &g, const z3::expr &v)')
         if False and isinstance(expr,HavocSymbol) or skip_z3:
@@ -1162,6 +1256,7 @@ def emit_action_gen(header,impl,name,action,classname):
 }
 """)
     open_scope(impl,line="void " + caname + "_gen::execute(" + classname + "& obj)")
+    code_line(impl,'__ivy_event_seq++')
     if action.formal_params:
         code_line(impl,'__ivy_out << "> {}("'.format(name.split(':')[-1]) + ' << "," '.join(' << {}'.format(varname(p)) for p in action.formal_params) + ' << ")" << std::endl')
     else:
@@ -1195,7 +1290,124 @@ def emit_derived(header,impl,df,classname,inline=False):
     action = ia.AssignAction(retval,rhs)
     action.formal_params = ps
     action.formal_returns = [retval]
-    emit_some_action(header,impl,name,action,classname,inline)
+    if inline or df.defines() not in memo_deps:
+        emit_some_action(header,impl,name,action,classname,inline)
+        return
+    emit_memo_derived(header,impl,df.defines(),action,classname)
+
+# With option memo=true, a definition whose value is computed with a
+# quantifier is cached per argument tuple. Each state symbol that such
+# a definition reads, directly or through other definitions, gets a
+# version counter that is incremented whenever the symbol is assigned.
+# A cache is valid while the sum of the versions of the symbols its
+# definition reads is unchanged, and is cleared on the first call
+# after that. State that native code writes without an antiquote is
+# not seen, so memo should not be used if definitions read such state.
+#
+# memo_deps maps each cached definition to the state symbols it reads,
+# and memo_dependents maps each of these symbols to the definitions.
+
+memo_deps = dict()
+memo_dependents = dict()
+
+def has_quantifier(fmla):
+    return il.is_quantifier(fmla) or any(has_quantifier(a) for a in fmla.args)
+
+def is_memo_key_sort(sort):
+    return (is_any_integer_type(sort) or sort.name in im.module.sort_destructors
+            or has_string_interp(sort))
+
+def compute_memo_deps():
+    global memo_deps, memo_dependents
+    memo_deps = dict()
+    memo_dependents = defaultdict(list)
+    if not opt_memo.get():
+        return
+    for ldf in im.module.definitions:
+        fmla = ldf.formula
+        sym = fmla.defines()
+        if not all(is_memo_key_sort(s) for s in sort_domain(sym.sort)):
+            continue
+        refs = set()
+        gather_referenced_symbols(fmla.args[1],refs,fmla.args[0].args)
+        if not (has_quantifier(fmla.args[1]) or
+                any(has_quantifier(is_derived[r].formula.args[1]) for r in refs
+                    if r in is_derived and is_derived[r] is not True)):
+            continue
+        deps = sorted((r for r in refs if sym_is_member(r) and r not in il.sig.constructors),
+                      key=lambda r: r.name)
+        memo_deps[sym] = deps
+        for r in deps:
+            memo_dependents[r].append(sym)
+
+def declare_memo_versions(header):
+    for sym in sorted(memo_dependents,key=lambda r: r.name):
+        header.append('    unsigned long long __ver__' + varname(sym) + ';\n')
+
+def init_memo_versions(impl):
+    for sym in sorted(memo_dependents,key=lambda r: r.name):
+        impl.append('    __ver__{} = 0;\n'.format(varname(sym)))
+    for sym in sorted(memo_deps,key=lambda r: r.name):
+        impl.append('    __memo_stamp__{} = (unsigned long long)-1;\n'.format(varname(sym)))
+
+# Emit code to increment the versions of the state symbols that may be
+# modified by writing the given terms.
+
+def emit_memo_invalidate(header,terms):
+    if not memo_dependents:
+        return
+    syms = set()
+    for t in terms:
+        for sym in ilu.used_symbols_ast(t):
+            if sym in memo_dependents:
+                syms.add(sym)
+    for sym in sorted(syms,key=lambda r: r.name):
+        code_line(header,'__ver__' + varname(sym) + '++')
+
+def emit_memo_derived(header,impl,sym,action,classname):
+    global indent_level
+    name = sym.name
+    raw = iu.compose_names(name,'_compute')
+    emit_some_action(header,impl,raw,action,classname)
+    emit_method_decl(header,name,action)
+    header.append(';\n')
+    memo = '__memo__' + varname(name)
+    stamp = '__memo_stamp__' + varname(name)
+    rty = ctypefull(sym.sort.rng,classname=classname)
+    dom = sort_domain(sym.sort)
+    params = [varname(p.name) for p in action.formal_params]
+    header.append('    unsigned long long ' + stamp + ';\n')
+    if dom:
+        kty = ctuple(dom,classname=classname)
+        mty = 'hash_space::hash_map<' + kty + ',' + rty + ' >'
+        header.append('    hash_space::hash_map<' + ctuple(dom) + ',' + ctypefull(sym.sort.rng) + ' > ' + memo + ';\n')
+    else:
+        header.append('    ' + ctypefull(sym.sort.rng) + ' ' + memo + ';\n')
+    code = []
+    emit_method_decl(code,name,action,body=True,classname=classname)
+    code.append('{\n')
+    indent_level += 1
+    deps = memo_deps[sym]
+    code_line(code,'unsigned long long __stamp = ' + (' + '.join('__ver__' + varname(d) for d in deps) or '0'))
+    open_scope(code,line='if (' + stamp + ' != __stamp)')
+    if dom:
+        code_line(code,memo + '.clear()')
+    else:
+        code_line(code,memo + ' = ' + funname(raw) + '()')
+    code_line(code,stamp + ' = __stamp')
+    close_scope(code)
+    if dom:
+        code_line(code,kty + ' __key(' + ','.join(params) + ')')
+        code_line(code,mty + '::iterator __it = ' + memo + '.find(__key)')
+        code_line(code,'if (__it != ' + memo + '.end()) return __it->second')
+        code_line(code,rty + ' __res = ' + funname(raw) + '(' + ','.join(params) + ')')
+        code_line(code,memo + '[__key] = __res')
+        code_line(code,'return __res')
+    else:
+        code_line(code,'return ' + memo)
+    indent_level -= 1
+    code.append('}\n')
+    impl.extend(code)
 
 def emit_constructor(header,impl,cons,classname,inline=False):
     name = cons.name
@@ -1413,7 +1625,7 @@ def trace_action(impl,name,action):
     indent(impl)
     if name.startswith('ext:'):
         name = name[4:]
-    impl.append('__ivy_out ' + number_format + ' << "< ' + name + '"')
+    impl.append('__ivy_event_seq++; __ivy_out ' + number_format + ' << "< ' + name + '"')
     if action.formal_params:
         impl.append(' << "("')
         first = True
@@ -1769,6 +1981,9 @@ def module_to_cpp_class(classname,basename):
 
     header.append("typedef std::string __strlit;\n")
     header.append("extern std::ofstream __ivy_out;\n")
+    header.append("extern unsigned long long __ivy_event_seq;\n")
+    header.append("extern std::string __ivy_capture_path;\n")
+    header.append("extern int __ivy_violations;\n")
     header.append("void __ivy_exit(int);\n")
     
     declare_hash_thunk(header)
@@ -1786,6 +2001,7 @@ def module_to_cpp_class(classname,basename):
 
     class reader;
     class timer;
+    class flusher;
 
 """)
 
@@ -1813,6 +2029,8 @@ def module_to_cpp_class(classname,basename):
     header.append('    void install_reader(reader *);\n')
     header.append('    void install_thread(reader *);\n')
     header.append('    void install_timer(timer *);\n')
+    header.append('    std::vector<flusher *> __flushers;\n')
+    header.append('    void install_flusher(flusher *f) {__flushers.push_back(f);}\n')
     header.append('    virtual ~{}();\n'.format(classname))
 
     header.append('    std::vector<int> ___ivy_stack;\n')
@@ -1826,6 +2044,7 @@ def module_to_cpp_class(classname,basename):
     
     with ivy_cpp.CppClassName(classname):
         emit_cpp_sorts(header)
+    compute_memo_deps()
 
         
     impl = ivy_cpp.context.impls.code
@@ -1849,6 +2068,7 @@ def module_to_cpp_class(classname,basename):
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netinet/ip.h> 
+#include <sys/un.h>
 #include <sys/select.h>
 #include <unistd.h>
 #define _open open
@@ -1856,6 +2076,7 @@ def module_to_cpp_class(classname,basename):
 #endif
 #include <string.h>
 #include <stdio.h>
+#include <errno.h>
 #include <string>
 #if __cplusplus < 201103L
 #else
@@ -1865,7 +2086,11 @@ def module_to_cpp_class(classname,basename):
     impl.append("typedef {} ivy_class;\n".format(classname))
     impl.append("std::ofstream __ivy_out;\n")
     impl.append("std::ofstream __ivy_modelfile;\n")
+    impl.append("unsigned long long __ivy_event_seq = 0;\n")
+    impl.append("std::string __ivy_capture_path;\n")
+    impl.append("int __ivy_violations = 0;\n")
     impl.append("void __ivy_exit(int code){exit(code);}\n")
+    impl.append("void __ivy_cannot_enumerate(const char *name){std::cerr << \"cannot enumerate \" << name << std::endl; __ivy_exit(1);}\n")
 
     impl.append("""
 class reader {
@@ -1884,6 +2109,19 @@ public:
     virtual ~timer() {}
 };
 
+// A flusher is called whenever the ivy lock is released, that is, at
+// the end of each atomic step. This lets native code defer work (such
+// as sending buffered output) to the end of the step. Flushers are
+// called in the reverse of the order they were installed, so that
+// one installed by a higher layer can pass work to a lower layer
+// that was initialized before it.
+
+class flusher {
+public:
+    virtual void flush() = 0;
+    virtual ~flusher() {}
+};
+
 #ifdef _WIN32
 DWORD WINAPI ReaderThreadFunction( LPVOID lpParam ) 
 {
@@ -2041,10 +2279,18 @@ void CLASSNAME::install_timer(timer *r) {
     impl.append("""
 #ifdef _WIN32
     void CLASSNAME::__lock() { WaitForSingleObject(mutex,INFINITE); }
-    void CLASSNAME::__unlock() { ReleaseMutex(mutex); }
+    void CLASSNAME::__unlock() {
+        for (unsigned i = __flushers.size(); i > 0; i--)
+            __flushers[i-1]->flush();
+        ReleaseMutex(mutex);
+    }
 #else
     void CLASSNAME::__lock() { pthread_mutex_lock(&mutex); }
-    void CLASSNAME::__unlock() { pthread_mutex_unlock(&mutex); }
+    void CLASSNAME::__unlock() {
+        for (unsigned i = __flushers.size(); i > 0; i--)
+            __flushers[i-1]->flush();
+        pthread_mutex_unlock(&mutex);
+    }
 #endif
 """.replace('CLASSNAME',classname))
     native_exprs = []
@@ -2097,10 +2343,18 @@ struct ivy_ser {
     virtual void  close_field() = 0;
     virtual void  open_tag(int, const std::string &) {throw deser_err();}
     virtual void  close_tag() {}
+    // If the list just opened can be written as a run of raw bytes,
+    // a serializer may accept it here in one step.
+    virtual bool  set_bytes(const unsigned *data, int len) {return false;}
     virtual ~ivy_ser(){}
 };
 struct ivy_binary_ser : public ivy_ser {
     std::vector<char> res;
+    // A serializer that needs the encoded size before writing may
+    // return true here. It is then run over the value once to measure
+    // it and, after start(), once more to write it.
+    virtual bool measure() {return false;}
+    virtual void start() {}
     void setn(long long inp, int len) {
         for (int i = len-1; i >= 0 ; i--)
             res.push_back((inp>>(8*i))&0xff);
@@ -2147,6 +2401,9 @@ struct ivy_deser {
     virtual int   open_tag(const std::vector<std::string> &) {throw deser_err();}
     virtual void  close_tag() {}
     virtual void  end() = 0;
+    // If the list just opened is a run of raw bytes, a deserializer may
+    // return it here, consuming it, so it can be read in one step.
+    virtual bool  get_bytes(const char *&data, int &len) {return false;}
     virtual ~ivy_deser(){}
 };
 
@@ -2392,6 +2649,33 @@ void __deser<bool>(ivy_deser &inp, bool &res) {
     res = thing;
 }
 
+// Read an opened list of numbers in one step, if the deserializer
+// supplies it as a run of bytes (see ivy_deser::get_bytes).
+
+template <class T> bool __deser_bytes(ivy_deser &inp, std::vector<T> &res) {
+    return false;
+}
+
+inline bool __deser_bytes(ivy_deser &inp, std::vector<unsigned> &res) {
+    const char *data;
+    int len;
+    if (!inp.get_bytes(data,len))
+        return false;
+    res.assign((const unsigned char *)data,(const unsigned char *)data + len);
+    return true;
+}
+
+// Write a list of numbers in one step, if the serializer accepts
+// it as a run of bytes (see ivy_ser::set_bytes).
+
+template <class T> bool __ser_bytes(ivy_ser &res, const std::vector<T> &inp) {
+    return false;
+}
+
+inline bool __ser_bytes(ivy_ser &res, const std::vector<unsigned> &inp) {
+    return inp.size() && res.set_bytes(&inp[0],inp.size());
+}
+
 class gen;
 
 """)
@@ -2617,6 +2901,7 @@ class z3_thunk : public thunk<D,R> {
         for sym in all_state_symbols():
             if sym_is_member(sym):
                 declare_symbol(header,sym)
+    declare_memo_versions(header)
 #    for sym in il.sig.constructors:
 #        declare_symbol(header,sym)
     for sname in il.sig.interp:
@@ -2674,6 +2959,7 @@ class z3_thunk : public thunk<D,R> {
     for sortname in il.sig.interp:
         if sortname in il.sig.sorts:
             impl.append('    __CARD__{} = {};\n'.format(varname(sortname),csortcard(il.sig.sorts[sortname])))
+    init_memo_versions(impl)
     for native in im.module.natives:
         tag = native_type(native)
         if tag == "init":
@@ -2985,8 +3271,12 @@ class z3_thunk : public thunk<D,R> {
 
 
                 emit_repl_boilerplate1a(header,impl,classname)
-                for actname in sorted(im.module.public_actions):
-                    username = actname[4:] if actname.startswith("ext:") else actname
+                actnames = repl_action_names()
+                for idx,actname in enumerate(actnames):
+                    username = repl_user_name(actname)
+                    impl.append('            ids["{}"] = {};\n'.format(username,idx))
+                emit_repl_boilerplate1b(header,impl,classname)
+                for actid,actname in enumerate(actnames):
                     action = im.module.actions[actname]
                     argstrings = ['_arg<{}>(args,{},{})'.format(ctype(x.sort,classname=classname),idx,csortcard(x.sort)) for idx,x in enumerate(action.formal_params)]
                     getargs = ','.join(argstrings)
@@ -3000,12 +3290,29 @@ class z3_thunk : public thunk<D,R> {
                             trace_code = '__ivy_out ' + number_format + ' << "{} {{"'.format(actname.split(':')[-1]) + ' << std::endl'
                         thing = trace_code + ';\n                    ' + thing + ';\n                    __ivy_out << "}" << std::endl' 
                     impl.append("""
-                if (action == "actname") {
-                    check_arity(args,numargs,action);
-                    thing;
-                }
-                else
-    """.replace('thing',thing).replace('actname',username).replace('methodname',varname(actname)).replace('numargs',str(len(action.formal_params))).replace('getargs',getargs))
+            case actid: {
+                check_arity(args,numargs,action);
+                thing;
+            } break;
+""".replace('actid',str(actid)).replace('thing',thing).replace('methodname',varname(actname)).replace('numargs',str(len(action.formal_params))).replace('getargs',getargs))
+                emit_repl_boilerplate1c(header,impl,classname)
+                for actid,actname in enumerate(actnames):
+                    action = im.module.actions[actname]
+                    impl.append('            case {}: {{\n'.format(actid))
+                    for pidx,x in enumerate(action.formal_params):
+                        ct = ctype(x.sort,classname=classname)
+                        impl.append('                {} a{};\n'.format(ct,pidx))
+                        impl.append('                __deser(inp,a{});\n'.format(pidx))
+                        if csortcard(x.sort) != "0" and (ct in ['int','unsigned','long long','unsigned long long']
+                                                         or isinstance(x.sort,il.EnumeratedSort)):
+                            impl.append('                if ((long long)a{} < 0 || (long long)a{} >= {})\n'.format(pidx,pidx,csortcard(x.sort)))
+                            impl.append('                    throw deser_err();\n')
+                    impl.append('                inp.end();\n')
+                    call = 'ivy.{}({})'.format(varname(actname),','.join('a{}'.format(pidx) for pidx in range(len(action.formal_params))))
+                    if action.formal_returns:
+                        call = '__ser(out,{})'.format(call)
+                    impl.append('                {};\n'.format(call))
+                    impl.append('            } break;\n')
                 emit_repl_boilerplate2(header,impl,classname)
 
 
@@ -3065,6 +3372,9 @@ class z3_thunk : public thunk<D,R> {
             else if (param == "wait") {
                 final_ms = atoi(value.c_str());
             }
+            else if (param == "capture") {
+                __ivy_capture_path = value;
+            }
             else if (param == "modelfile") {
                 __ivy_modelfile.open(value.c_str());
                 if (!__ivy_modelfile) {
@@ -3072,6 +3382,31 @@ class z3_thunk : public thunk<D,R> {
                     return 1;
                 }
             }
+""")
+                if target.get() == "repl":
+                    impl.append("""
+            else if (param == "protocol") {
+                if (value == "binary")
+                    __ivy_binary = true;
+                else if (value != "text") {
+                    std::cerr << "unknown protocol: " << value << std::endl;
+                    return 1;
+                }
+            }
+            else if (param == "socket") {
+                __ivy_socket_path = value;
+            }
+""")
+                    if monitor_mode:
+                        impl.append("""
+            else if (param == "log") {
+                __ivy_log = (value == "true");
+            }
+            else if (param == "max_violations") {
+                __ivy_max_violations = atoi(value.c_str());
+            }
+""")
+                impl.append("""
             else {
                 std::cerr << "unknown option: " << param << std::endl;
                 return 1;
@@ -3083,6 +3418,18 @@ class z3_thunk : public thunk<D,R> {
         __ivy_out.basic_ios<char>::rdbuf(std::cout.rdbuf());
     argc = pargs.size();
     argv = &pargs[0];
+""")
+                if target.get() == "repl" and any(im.module.actions[name].formal_returns for name in repl_import_names()):
+                    impl.append("""
+    if (__ivy_binary) {
+        std::cerr << "protocol=binary does not support imported actions with return values" << std::endl;
+        return 1;
+    }
+""")
+                if target.get() == "repl":
+                    impl.append("""
+    if (__ivy_socket_path.size() && !__ivy_accept_unix(__ivy_socket_path))
+        return 1;
 """)
                 impl.append("    if (argc == "+str(len(pos_params)+2)+"){\n")
                 impl.append("        argc--;\n")
@@ -3434,6 +3781,10 @@ def emit_app(self,header,code,capture_args=None):
             a.emit(header,code)
             first = False
         code.append(')')
+    elif skip_params == 0 and is_indexed_relation(self.rep):
+        code.append('.get(')
+        emit_hash_key(self,header,code,capture_args)
+        code.append(')')
     elif is_large_type(self.rep.sort) and len(self.args[skip_params:]) > 1:
         code.append('[' + ctuple(self.rep.sort.dom[skip_params:],classname=the_classname) + '(')
         first = True
@@ -3451,6 +3802,27 @@ def emit_app(self,header,code,capture_args=None):
 
 lg.Apply.emit = emit_app
 
+# A relation over a large domain is stored in a hash_thunk that keeps an
+# index of its true points (see declare_hash_thunk). The generated code
+# reads it with get and writes it with set, which keep the index up to
+# date and do not add the points that are read to the memo.
+
+def is_indexed_relation(sym):
+    return (sym_is_member(sym) and hasattr(sym.sort,'dom') and il.is_boolean_sort(sym.sort.rng)
+            and is_large_type(sym.sort))
+
+def emit_hash_key(app,header,code,capture_args=None):
+    if len(app.args) > 1:
+        code.append(ctuple(app.rep.sort.dom,classname=the_classname) + '(')
+    first = True
+    for a in app.args:
+        if not first:
+            code.append(',')
+        capture_emit(a,header,code,capture_args)
+        first = False
+    if len(app.args) > 1:
+        code.append(')')
+
 class HavocSymbol(object):
     def __init__(self,sort,name,unique_id):
         self.sort,self.name,self.unique_id = sort,name,unique_id
@@ -3581,17 +3953,27 @@ def emit_quant(variables,body,header,code,exists=False):
                 return
         raise iu.IvyError(None,'type {} is not a variant of type {}'.format(vsortname,rsort))
 
+    row = row_guard(variables,body,exists)
+    if row is not None:
+        emit_row_quant(row,header,code,exists)
+        return
+
     v0 = variables[0]
     variables = variables[1:]
     has_iter = il.is_uninterpreted_sort(v0.sort) and iu.compose_names(v0.sort.name,'iterable') in im.module.attributes
+    guard = None if has_iter else sparse_guard(v0,variables,body,exists)
     if has_iter:
         iter = iu.compose_names(v0.sort.name,'iter')
-    else:
+    elif guard is None:
         check_iterable_sort(v0.sort)
     res = new_temp(header)
     idx = v0.name
     indent(header)
     header.append(res + ' = ' + str(0 if exists else 1) + ';\n')
+    if guard is not None:
+        emit_sparse_quant(v0,variables,body,header,res,exists,guard)
+        code.append(res)
+        return
     indent(header)
     if has_iter:
         iter_sort_name = iter
@@ -3613,17 +3995,143 @@ def emit_quant(variables,body,header,code,exists=False):
         ct = ctype(v0.sort)
         ct = 'int' if ct == 'bool' else ct if ct in int_ctypes else 'int'
         header.append('for (' + ct + ' ' + idx + ' = ' + lo + '; ' + idx + ' < ' + hi + '; ' + idx + '++) {\n')
+    emit_quant_loop_body(variables,body,header,res,exists)
+    code.append(res)    
+
+def emit_quant_loop_body(variables,body,header,res,exists):
+    global indent_level
     indent_level += 1
     subcode = []
     emit_quant(variables,body,header,subcode,exists)
     indent(header)
     header.append('if (' + ('!' if not exists else ''))
     header.extend(subcode)
-    header.append(') '+ res + ' = ' + str(1 if exists else 0) + ';\n')
+    header.append(') {'+ res + ' = ' + str(1 if exists else 0) + '; break;}\n')
+    indent_level -= 1
+    indent(header)
+    header.append('}\n')
+
+# A quantifier over the last arguments of a relation stored as an
+# array, such as `exists Y. r(a,Y)` or `forall X,Y. ~r(X,Y)`, asks
+# whether a contiguous block of the array holds a given value. We
+# search the block with memchr, which compares many bytes at a time and
+# stops at the first match. The guard is returned as (atom,number of
+# leading arguments,value), where the quantifier holds if the value
+# occurs in the block (for exists) or does not occur (for forall).
+
+def row_guard(variables,body,exists):
+    neg = isinstance(body,il.Not)
+    atom = body.args[0] if neg else body
+    if not (il.is_app(atom) and atom.rep in il.sig.symbols.values() and sym_is_member(atom.rep)
+            and il.is_boolean(atom) and not is_large_type(atom.rep.sort)):
+        return None
+    nlead = len(atom.args) - len(variables)
+    if nlead < 0 or set(atom.args[nlead:]) != set(variables):
+        return None
+    if any(set(variables) & set(lu.free_variables(a)) for a in atom.args[:nlead]):
+        return None
+    return (atom,nlead,1 if exists != neg else 0)
+
+def emit_row_quant(guard,header,code,exists):
+    atom,nlead,val = guard
+    row = [funname(atom.rep.name)]
+    for a in atom.args[:nlead]:
+        row.append('[')
+        a.emit(header,row)
+        row.append(']')
+    row = ''.join(row)
+    code.append('(memchr(&{},{},sizeof({})) {} 0)'.format(row,val,row,'!=' if exists else '=='))
+
+# A quantifier over a variable v0 whose sort is too large to loop over
+# can still be evaluated if every witness (for exists) or every
+# counterexample (for forall) must satisfy an atom r(...,v0,...), where
+# r is a relation stored in a hash_thunk. If r is sparse at run time,
+# the candidate values of v0 come from the true points of r, looked up
+# by another argument of the atom if one is fixed. Otherwise we fall
+# back to a bounded loop if there is one. The guard is returned as
+# (r,position of v0,atom), or None.
+
+def sparse_guard(v0,variables,body,exists):
+    card = sort_card(v0.sort) if is_any_integer_type(v0.sort) else None
+    if card is not None and card <= large_thresh:
+        return None
+    def conjuncts(fmla):
+        return [y for x in fmla.args for y in conjuncts(x)] if isinstance(fmla,il.And) else [fmla]
+    if exists:
+        cands = conjuncts(body)
+    else:
+        disjs = list(body.args) if isinstance(body,il.Or) else [body]
+        cands = []
+        for d in disjs:
+            if isinstance(d,il.Not):
+                cands.append(d.args[0])
+            elif isinstance(d,il.Implies):
+                cands.extend(conjuncts(d.args[0]))
+    for atom in cands:
+        if not (il.is_app(atom) and atom.rep in il.sig.symbols.values() and is_indexed_relation(atom.rep)):
+            continue
+        for pos,arg in enumerate(atom.args):
+            if arg == v0 and not any(v0 in lu.free_variables(a) for p,a in enumerate(atom.args) if p != pos):
+                return (atom.rep,pos,atom)
+    return None
+
+def emit_sparse_quant(v0,variables,body,header,res,exists,guard):
+    global indent_level
+    sym,pos,atom = guard
+    name = varname(sym)
+    ty = ctype_function(sym.sort,classname=the_classname)[0]
+    it = '__it' + res
+    vals = '__vals' + res
+    vty = ctypefull(v0.sort,classname=the_classname)
+    bound = set([v0] + list(variables))
+    indent(header)
+    header.append('if (' + name + '.sparse()) {\n')
+    indent_level += 1
+    filters = [(p,code_eval(header,arg)) for p,arg in enumerate(atom.args)
+               if p != pos and not (bound & set(lu.free_variables(arg)))]
+    field = (lambda n: '(*' + it + ')') if len(atom.args) == 1 else (lambda n: '(*' + it + ').arg' + str(n))
+    # If some other argument is fixed, we look up the true points by
+    # its hash, otherwise we go through all the true points. The body
+    # may look up the relation again, which can rebuild its index, so
+    # the candidates are collected before the body runs.
+    if filters:
+        p,e = filters[0]
+        points = '{}.lookup({},hash_space::hash<{}>()({}))'.format(name,p,hashtype(atom.args[p].sort,classname=the_classname),e)
+    else:
+        points = name + '.nondefault()'
+    pts = '__pts' + res
+    code_line(header,'const ' + ty + '::point_set &' + pts + ' = ' + points)
+    code_line(header,'std::vector<' + vty + ' > ' + vals)
+    open_scope(header,line='for (' + ty + '::point_set::const_iterator ' + it + ' = ' + pts + '.begin(); ' + it + ' != ' + pts + '.end(); ++' + it + ')')
+    for p,e in filters:
+        code_line(header,'if (!(' + field(p) + ' == ' + e + ')) continue')
+    code_line(header,vals + '.push_back(' + field(pos) + ')')
+    close_scope(header)
+    idx = '__idx' + res
+    open_scope(header,line='for (unsigned ' + idx + ' = 0; ' + idx + ' < ' + vals + '.size(); ' + idx + '++)')
+    code_line(header,'const ' + vty + ' &' + varname(v0.name) + ' = ' + vals + '[' + idx + ']')
+    indent_level -= 1
+    emit_quant_loop_body(variables,body,header,res,exists)
+    indent_level -= 1
+    indent(header)
+    header.append('}\n')
+    indent(header)
+    header.append('else {\n')
+    indent_level += 1
+    try:
+        check_iterable_sort(v0.sort)
+        lo,hi = get_bounds(header,v0,variables,body,exists)
+    except iu.IvyError:
+        code_line(header,'__ivy_cannot_enumerate("{}")'.format(sym.name))
+    else:
+        ct = ctype(v0.sort)
+        ct = 'int' if ct == 'bool' else ct if ct in int_ctypes else 'int'
+        indent(header)
+        header.append('for (' + ct + ' ' + v0.name + ' = ' + lo + '; ' + v0.name + ' < ' + hi + '; ' + v0.name + '++) {\n')
+        emit_quant_loop_body(variables,body,header,res,exists)
     indent_level -= 1
     indent(header)
     header.append('}\n')
-    code.append(res)    
 
 
 lg.ForAll.emit = lambda self,header,code: emit_quant(list(self.variables),self.body,header,code,False)
@@ -3785,22 +4293,37 @@ def emit_traced_lhs(self,trace,captured_args):
 def emit_assign_simple(self,header):
     code = []
     indent(code)
-    if opt_trace.get() and ':' not in self.args[0].rep.name:
+    lhs = self.args[0]
+    indexed = il.is_app(lhs) and is_indexed_relation(lhs.rep)
+    if opt_trace.get() and ':' not in lhs.rep.name:
         trace = []
         indent(trace)
         trace.append('__ivy_out ' + number_format + ' << "  write("')
         cargs = []
-        if il.is_constant(self.args[0]):
-            self.args[0].emit(header,code)
+        if indexed:
+            code.append(funname(lhs.rep.name) + '.set(')
+            emit_hash_key(lhs,header,code,cargs)
+            code.append(',')
+        elif il.is_constant(lhs):
+            lhs.emit(header,code)
         else:
-            emit_app(self.args[0],header,code,cargs)
-        emit_traced_lhs(self.args[0],trace,cargs)
-        code.append(' = ')
+            emit_app(lhs,header,code,cargs)
+        emit_traced_lhs(lhs,trace,cargs)
+        if not indexed:
+            code.append(' = ')
         rhs = []
         self.args[1].emit(header,rhs)
         code.extend(rhs)
+        if indexed:
+            code.append(')')
         trace.extend(' << "," << (' + ''.join(rhs) + ') << ")" << std::endl;\n')
         header.extend(trace)
+    elif indexed:
+        code.append(funname(lhs.rep.name) + '.set(')
+        emit_hash_key(lhs,header,code)
+        code.append(',')
+        self.args[1].emit(header,code)
+        code.append(')')
     else:
         self.args[0].emit(header,code)
         code.append(' = ')
@@ -3822,7 +4345,38 @@ def emit_assign_large(self,header):
 
     code_line(header,varname(self.args[0].rep)+' = ' + make_thunk(thunks,vs,expr))
 
+# An assignment to a function or relation at many points can be done in
+# place, without first computing the new values in a temporary array,
+# if the new value at each point depends only on the old value at the
+# same point, for example `r(X,Y) := r(X,Y) & ~(X = a)`. This requires
+# that the arguments on the left be distinct variables, so that each
+# point is written once, and that the right-hand side read the updated
+# symbol only at those same variables. A variable bound in the
+# right-hand side, as in `r(X) := r(X) | exists X. r(X)`, is not the
+# same variable, so we give up if any of the variables is rebound.
+# Derived functions may read the updated symbol, so we don't look into
+# them.
+
+def binds_any(term,vs):
+    if il.is_binder(term) and any(v in vs for v in term.variables):
+        return True
+    return any(binds_any(a,vs) for a in term.args)
+
+def is_pointwise_update(lhs,rhs):
+    if not all(il.is_variable(a) for a in lhs.args) or len(set(lhs.args)) != len(lhs.args):
+        return False
+    for sym in ilu.used_symbols_ast(rhs):
+        if sym in is_derived and is_derived[sym] is not True:
+            return False
+    if binds_any(rhs,set(lhs.args)):
+        return False
+    return all(app.args == lhs.args for app in ilu.apps_ast(rhs) if app.rep == lhs.rep)
+
 def emit_assign(self,header):
+    emit_assign_value(self,header)
+    emit_memo_invalidate(header,[self.args[0]])
+
+def emit_assign_value(self,header):
     global indent_level
     with ivy_ast.ASTContext(self):
 #        if is_large_type(self.args[0].rep.sort) and lu.free_variables(self.args[0]):
@@ -3835,6 +4389,24 @@ def emit_assign(self,header):
         if len(vs) == 0:
             emit_assign_simple(self,header)
             return
+        if is_pointwise_update(self.args[0],self.args[1]):
+            for idx in vs:
+                indent(header)
+                vn = varname(idx.name)
+                header.append('for (int ' + vn + ' = 0; ' + vn + ' < ' + str(sort_card(idx.sort)) + '; ' + vn + '++) {\n')
+                indent_level += 1
+            code = []
+            indent(code)
+            self.args[0].emit(header,code)
+            code.append(' = ')
+            self.args[1].emit(header,code)
+            code.append(';\n')
+            header.extend(code)
+            for idx in vs:
+                indent_level -= 1
+                indent(header)
+                header.append('}\n')
+            return
         global temp_ctr
         tmp = '__tmp' + str(temp_ctr)
         temp_ctr += 1
@@ -3980,6 +4552,7 @@ def emit_call(self,header):
         rv.emit(header,code)
         code.append(' = ' + retval + ';\n')
     header.extend(code)
+    emit_memo_invalidate(header,self.args[1:])
     if target.get() in ["gen","test"]:
         indent(header)
         header.append('___ivy_stack.pop_back();\n')
@@ -4122,12 +4695,32 @@ def emit_native_action(self,header):
         return s[:-1] if s.endswith('%') else s
     fields = [(nfun(idx)(self.args[int(s)+1]) if idx % 2 == 1 else dm(s)) for idx,s in enumerate(fields)]
     indent_code(header,''.join(fields))
+    emit_memo_invalidate(header,self.args[1:])
 
 ia.NativeAction.emit = emit_native_action
 
 def emit_repl_imports(header,impl,classname):
     pass
 
+# The name by which the repl user calls an exported action
+
+def repl_user_name(actname):
+    return actname[4:] if actname.startswith("ext:") else actname
+
+# Exported actions, in the order in which they are numbered by the
+# binary command protocol, that is, in alphabetical order of the names
+# the user calls them by.
+
+def repl_action_names():
+    return sorted(im.module.public_actions,key=repl_user_name)
+
+# Imported actions that are called back through the repl, in the order
+# in which they are numbered by the binary command protocol.
+
+def repl_import_names():
+    return sorted(set(imp.imported() for imp in im.module.imports
+                      if not imp.scope() and imp.imported() in im.module.actions))
+
 def emit_repl_boilerplate1(header,impl,classname):
     impl.append("""
 
@@ -4142,7 +4735,78 @@ int ask_ret(long long bound) {
     }
 }
 
-""")
+// With protocol=binary, commands and their results are exchanged as
+// frames (see binary_cmd_reader). A frame is a 4-byte big-endian
+// length followed by that many bytes.
+
+bool __ivy_binary = false;
+std::string __ivy_socket_path;
+
+// A monitor (see target=monitor) counts the violations of assertions
+// and assumptions in __ivy_violations. It stops after max_violations
+// of them, if that is non-zero. Calls to imported actions are printed if
+// __ivy_log is set.
+
+int __ivy_max_violations = 0;
+bool __ivy_log = IVY_LOG;
+
+int __ivy_report_violations() {
+    if (__ivy_violations)
+        std::cerr << __ivy_violations << " violation(s)" << std::endl;
+    return __ivy_violations ? 1 : 0;
+}
+
+void __ivy_write_frame(const std::vector<char> &bytes) {
+    char len[4];
+    for (int i = 0; i < 4; i++)
+        len[i] = (bytes.size() >> (8*(3-i))) & 0xff;
+    __ivy_out.write(len,4);
+    if (bytes.size())
+        __ivy_out.write(&bytes[0],bytes.size());
+}
+
+// With socket=path, accept one connection on a Unix domain socket at
+// path and use it in place of the standard input and output.
+
+bool __ivy_accept_unix(const std::string &path) {
+#ifdef _WIN32
+    std::cerr << "the socket option is not supported on this platform" << std::endl;
+    return false;
+#else
+    struct sockaddr_un addr;
+    memset(&addr,0,sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "socket path too long: " << path << std::endl;
+        return false;
+    }
+    strcpy(addr.sun_path,path.c_str());
+    unlink(path.c_str());
+    int sock = socket(AF_UNIX,SOCK_STREAM,0);
+    if (sock < 0 || bind(sock,(struct sockaddr *)&addr,sizeof(addr)) < 0 || listen(sock,1) < 0) {
+        std::cerr << "cannot listen on socket: " << path << std::endl;
+        return false;
+    }
+    int conn = accept(sock,0,0);
+    if (conn < 0) {
+        std::cerr << "cannot accept on socket: " << path << std::endl;
+        return false;
+    }
+    close(sock);
+    _dup2(conn,0);
+    _dup2(conn,1);
+    close(conn);
+    return true;
+#endif
+}
+
+""".replace('IVY_LOG','false' if monitor_mode else 'true'))
+
+    if monitor_mode:
+        on_violation = """if (++__ivy_violations == __ivy_max_violations)
+                __ivy_exit(__ivy_report_violations());"""
+    else:
+        on_violation = ('__ivy_out << "}" << std::endl;\n            ' if opt_trace.get() else '') + '__ivy_exit(1);'
 
     impl.append("""
 
@@ -4154,19 +4818,17 @@ int ask_ret(long long bound) {
         if (!truth) {
             __ivy_out << "assertion_failed(\\"" << msg << "\\")" << std::endl;
             std::cerr << msg << ": error: assertion failed\\n";
-            CLOSE_TRACE
-            __ivy_exit(1);
+            ON_VIOLATION
         }
     }
     virtual void ivy_assume(bool truth,const char *msg){
         if (!truth) {
             __ivy_out << "assumption_failed(\\"" << msg << "\\")" << std::endl;
             std::cerr << msg << ": error: assumption failed\\n";
-            CLOSE_TRACE
-            __ivy_exit(1);
+            ON_VIOLATION
         }
     }
-    """.replace('classname',classname).replace('CLOSE_TRACE','__ivy_out << "}" << std::endl;' if opt_trace.get() else ''))
+    """.replace('classname',classname).replace('ON_VIOLATION',on_violation))
 
     emit_param_decls(impl,classname+'_repl',im.module.params)
     impl.append(' : '+classname+'('+','.join(map(varname,im.module.params))+'){}\n')
@@ -4179,7 +4841,16 @@ int ask_ret(long long bound) {
             if target.get() == "test":
                 impl.append("{}\n")
                 continue
-            impl.append('{\n    __ivy_out ' + number_format + ' << "< ' + name[5:] + '"')
+            impl.append('{\n    __ivy_event_seq++;\n')
+            if monitor_mode and not action.formal_returns:
+                impl.append('    if (!__ivy_log)\n        return;\n')
+            impl.append('    if (__ivy_binary) {\n        ivy_binary_ser __frame;\n')
+            impl.append('        __frame.set((long long)2);\n')
+            impl.append('        __frame.set((long long){});\n'.format(repl_import_names().index(name)))
+            for arg in action.formal_params:
+                impl.append('        __ser(__frame,{});\n'.format(varname(arg.rep.name)))
+            impl.append('        __ivy_write_frame(__frame.res);\n        __ivy_out.flush();\n    }\n    else\n')
+            impl.append('    __ivy_out ' + number_format + ' << "< ' + name[5:] + '"')
             if action.formal_params:
                 impl.append(' << "("')
                 first = True
@@ -4213,7 +4884,19 @@ bool is_ident(int c) {
         || (c >= '0' &&  c <= '9');
 }
 
-void skip_white(const std::string& str, int &pos){
+// A non-owning view of a command line in the input buffer. The parser
+// below works on either this or a std::string.
+
+struct ivy_text {
+    const char *ptr;
+    int len;
+    ivy_text(const char *ptr, int len) : ptr(ptr), len(len) {}
+    int size() const {return len;}
+    const char *data() const {return ptr;}
+    char operator[](int i) const {return ptr[i];}
+};
+
+template <class S> void skip_white(const S& str, int &pos){
     while (pos < str.size() && is_white(str[pos]))
         pos++;
 }
@@ -4227,18 +4910,16 @@ void throw_syntax(int pos){
     throw syntax_error(pos);
 }
 
-std::string get_ident(const std::string& str, int &pos) {
-    std::string res = "";
-    while (pos < str.size() && is_ident(str[pos])) {
-        res.push_back(str[pos]);
+template <class S> std::string get_ident(const S& str, int &pos) {
+    int start = pos;
+    while (pos < str.size() && is_ident(str[pos]))
         pos++;
-    }
-    if (res.size() == 0)
+    if (pos == start)
         throw_syntax(pos);
-    return res;
+    return std::string(str.data() + start, pos - start);
 }
 
-ivy_value parse_value(const std::string& cmd, int &pos) {
+template <class S> ivy_value parse_value_text(const S& cmd, int &pos) {
     ivy_value res;
     res.pos = pos;
     skip_white(cmd,pos);
@@ -4248,7 +4929,7 @@ ivy_value parse_value(const std::string& cmd, int &pos) {
             skip_white(cmd,pos);
             if (pos < cmd.size() && cmd[pos] == ']')
                 break;
-            res.fields.push_back(parse_value(cmd,pos));
+            res.fields.push_back(parse_value_text(cmd,pos));
             skip_white(cmd,pos);
             if (pos < cmd.size() && cmd[pos] == ']')
                 break;
@@ -4268,7 +4949,7 @@ ivy_value parse_value(const std::string& cmd, int &pos) {
                  throw_syntax(pos);
             pos++;
             skip_white(cmd,pos);
-            field.fields.push_back(parse_value(cmd,pos));
+            field.fields.push_back(parse_value_text(cmd,pos));
             res.fields.push_back(field);
             skip_white(cmd,pos);
             if (pos < cmd.size() && cmd[pos] == '}')
@@ -4280,7 +4961,10 @@ ivy_value parse_value(const std::string& cmd, int &pos) {
     }
     else if (pos < cmd.size() && cmd[pos] == '"') {
         pos++;
-        res.atom = "";
+        int start = pos;
+        while (pos < cmd.size() && cmd[pos] != '"' && cmd[pos] != '\\\\')
+            pos++;
+        res.atom.assign(cmd.data() + start, pos - start);
         while (pos < cmd.size() && cmd[pos] != '"') {
             char c = cmd[pos++];
             if (c == '\\\\') {
@@ -4300,7 +4984,15 @@ ivy_value parse_value(const std::string& cmd, int &pos) {
     return res;
 }
 
-void parse_command(const std::string &cmd, std::string &action, std::vector<ivy_value> &args) {
+ivy_value parse_value(const std::string& cmd, int &pos) {
+    return parse_value_text(cmd,pos);
+}
+
+ivy_value parse_value(const ivy_text& cmd, int &pos) {
+    return parse_value_text(cmd,pos);
+}
+
+template <class S> void parse_command(const S &cmd, std::string &action, std::vector<ivy_value> &args) {
     int pos = 0;
     skip_white(cmd,pos);
     action = get_ident(cmd,pos);
@@ -4342,11 +5034,32 @@ void check_arity(std::vector<ivy_value> &args, unsigned num, std::string &action
 def emit_repl_boilerplate1a(header,impl,classname):
     impl.append("""
 
+// Read up to len bytes from stdin, retrying if interrupted by a
+// signal. Returns zero only at end of input. Other errors are fatal.
+
+int __ivy_read_stdin(char *buf, size_t len) {
+    int chars;
+    do
+        chars = ::read(0,buf,len);
+    while (chars < 0 && errno == EINTR);
+    if (chars < 0)
+        {perror("read from stdin failed"); __ivy_exit(1);}
+    return chars;
+}
+
+// This reads lines from stdin. It reads as much input as is available,
+// up to a large limit, and passes all of the complete lines to
+// process_lines at once, as views into the buffer. Consumed input is
+// discarded once per read, not once per line.
+
 class stdin_reader: public reader {
-    std::string buf;
+protected:
+    std::vector<char> buf;
+    size_t scanned;           // bytes already searched for newline
     std::string eof_flag;
 
 public:
+    stdin_reader() : scanned(0) {}
     bool eof(){
       return eof_flag.size();
     }
@@ -4354,24 +5067,41 @@ public:
         return 0;
     }
     virtual void read() {
-        char tmp[257];
-        int chars = ::read(0,tmp,256);
+        size_t old_size = buf.size();
+        size_t want = 1 << 16;
+        buf.resize(old_size + want);
+        int chars = __ivy_read_stdin(&buf[old_size],want);
+        buf.resize(old_size + chars);
+        std::vector<ivy_text> lines;
+        size_t begin = 0;
+        char *base = buf.empty() ? 0 : &buf[0];
+        while (scanned < buf.size()) {
+            char *nl = (char *)memchr(base + scanned,'\\n',buf.size() - scanned);
+            if (!nl) {
+                scanned = buf.size();
+                break;
+            }
+            size_t end = nl - base + 1;
+            lines.push_back(ivy_text(base + begin,end - begin));
+            begin = scanned = end;
+        }
         if (chars == 0) {  // EOF
-            if (buf.size())
-                process(buf);
+            if (begin < buf.size())
+                lines.push_back(ivy_text(base + begin,buf.size() - begin));
+            begin = buf.size();
             eof_flag = "eof";
         }
-        tmp[chars] = 0;
-        buf += std::string(tmp);
-        size_t pos;
-        while ((pos = buf.find('\\n')) != std::string::npos) {
-            std::string line = buf.substr(0,pos+1);
-            buf.erase(0,pos+1);
-            process(line);
-        }
+        if (lines.size())
+            process_lines(lines);
+        buf.erase(buf.begin(),buf.begin()+begin);
+        scanned -= begin;
+    }
+    virtual void process_lines(const std::vector<ivy_text> &lines) {
+        for (unsigned i = 0; i < lines.size(); i++)
+            process(lines[i]);
     }
-    virtual void process(const std::string &line) {
-        __ivy_out << line;
+    virtual void process(const ivy_text &line) {
+        __ivy_out << std::string(line.data(),line.size());
     }
 };
 
@@ -4386,38 +5116,141 @@ public:
             __ivy_out << "> "; __ivy_out.flush();
     }
 
-    virtual void process(const std::string &cmd) {
+    // All of the commands available are executed in one atomic step.
+
+    virtual void process_lines(const std::vector<ivy_text> &lines) {
+        ivy.__lock();
+        for (unsigned i = 0; i < lines.size(); i++)
+            process(lines[i]);
+        ivy.__unlock();
+    }
+
+    // Execute one command. Called with the ivy lock held.
+
+    virtual void process(const ivy_text &cmd) {
         std::string action;
         std::vector<ivy_value> args;
         try {
             parse_command(cmd,action,args);
-            ivy.__lock();
-""".replace('classname',classname))
-
-
-def emit_repl_boilerplate2(header,impl,classname):
-    impl.append("""
-            {
+            int id = action_id(action);
+            if (id < 0)
                 std::cerr << "undefined action: " << action << std::endl;
-            }
-            ivy.__unlock();
+            else
+                call(id,action,args);
         }
         catch (syntax_error& err) {
-            ivy.__unlock();
             std::cerr << "line " << lineno << ":" << err.pos << ": syntax error" << std::endl;
         }
         catch (out_of_bounds &err) {
-            ivy.__unlock();
             std::cerr << "line " << lineno << ":" << err.pos << ": " << err.txt << " bad value" << std::endl;
         }
         catch (bad_arity &err) {
-            ivy.__unlock();
             std::cerr << "action " << err.action << " takes " << err.num  << " input parameters" << std::endl;
         }
         if (isatty(fdes()))
             __ivy_out << "> "; __ivy_out.flush();
         lineno++;
     }
+
+    // Get the number of an action from its name, or -1 if there is no
+    // such action. The actions are numbered in alphabetical order.
+
+    static int action_id(const std::string &action) {
+        static hash_space::hash_map<std::string,int> ids;
+        if (ids.empty()) {
+""".replace('classname',classname))
+
+def emit_repl_boilerplate1b(header,impl,classname):
+    impl.append("""
+        }
+        hash_space::hash_map<std::string,int>::iterator it = ids.find(action);
+        return it == ids.end() ? -1 : it->second;
+    }
+
+    // Execute action number id, with arguments in text form.
+
+    void call(int id, std::string &action, std::vector<ivy_value> &args) {
+        switch (id) {
+""")
+
+def emit_repl_boilerplate1c(header,impl,classname):
+    impl.append("""
+        }
+    }
+
+    // Execute action number id, reading its arguments from inp and
+    // writing its return value, if any, to out.
+
+    void call_binary(long long id, ivy_binary_deser &inp, ivy_binary_ser &out) {
+        switch (id) {
+""")
+
+
+def emit_repl_boilerplate2(header,impl,classname):
+    impl.append("""
+        default:
+            throw deser_err();
+        }
+    }
+};
+
+// This reads commands in the binary protocol from stdin. Each command
+// is a frame holding the number of an action (see cmd_reader::action_id)
+// followed by its input parameters, encoded as by ivy_binary_ser. It
+// is answered by a frame holding 0 followed by the action's return
+// value, if any, or by a frame holding 1 if the command cannot be
+// decoded. A call to an imported action is sent as a frame holding 2,
+// the number of the import in alphabetical order, and its parameters.
+
+class binary_cmd_reader: public cmd_reader {
+public:
+    binary_cmd_reader(classname_repl &_ivy) : cmd_reader(_ivy) {}
+
+    // All of the complete frames available are executed in one atomic
+    // step, and the results are flushed once.
+
+    virtual void read() {
+        size_t old_size = buf.size();
+        size_t want = 1 << 16;
+        buf.resize(old_size + want);
+        int chars = __ivy_read_stdin(&buf[old_size],want);
+        buf.resize(old_size + chars);
+        if (chars == 0)  // EOF
+            eof_flag = "eof";
+        size_t begin = 0;
+        ivy.__lock();
+        while (buf.size() - begin >= 4) {
+            size_t len = 0;
+            for (int i = 0; i < 4; i++)
+                len = (len << 8) | (unsigned char)buf[begin+i];
+            if (buf.size() - begin - 4 < len)
+                break;
+            std::vector<char> frame(buf.begin()+begin+4,buf.begin()+begin+4+len);
+            begin += 4 + len;
+            process_frame(frame);
+        }
+        ivy.__unlock();
+        __ivy_out.flush();
+        buf.erase(buf.begin(),buf.begin()+begin);
+    }
+
+    // Execute one command. Called with the ivy lock held.
+
+    void process_frame(const std::vector<char> &frame) {
+        ivy_binary_deser inp(frame);
+        ivy_binary_ser out;
+        try {
+            long long id;
+            inp.get(id);
+            out.set((long long)0);
+            call_binary(id,inp,out);
+        }
+        catch (deser_err &) {
+            out.res.clear();
+            out.set((long long)1);
+        }
+        __ivy_write_frame(out.res);
+    }
 };
 
 
@@ -4468,13 +5301,13 @@ def emit_repl_boilerplate3(header,impl,classname):
 
     ivy.__unlock();
 
-    cmd_reader *cr = new cmd_reader(ivy);
+    cmd_reader *cr = __ivy_binary ? new binary_cmd_reader(ivy) : new cmd_reader(ivy);
 
     // The main thread runs the console reader
 
     while (!cr->eof())
         cr->read();
-    return 0;
+    return __ivy_report_violations();
 
 """.replace('classname',classname))
 
@@ -4496,7 +5329,7 @@ def emit_repl_boilerplate3server(header,impl,classname):
         ivy.__unlock();
         pthread_join(tid,NULL);
     }
-    return 0;
+    return __ivy_report_violations();
 
 """.replace('classname',classname))
 
@@ -5117,7 +5950,7 @@ public:
 };
 """.replace('classname',classname))
 
-target = iu.EnumeratedParameter("target",["impl","gen","repl","test","class"],"gen")
+target = iu.EnumeratedParameter("target",["impl","gen","repl","test","class","monitor"],"gen")
 opt_classname = iu.Parameter("classname","")
 opt_build = iu.BooleanParameter("build",False)
 opt_trace = iu.BooleanParameter("trace",False)
@@ -5127,9 +5960,17 @@ opt_compiler = iu.EnumeratedParameter("compiler",["g++","cl","default"],"default
 opt_main = iu.Parameter("main","main")
 opt_stdafx = iu.BooleanParameter("stdafx",False)
 opt_outdir = iu.Parameter("outdir","")
+opt_memo = iu.BooleanParameter("memo",False)
 
 emit_main = True
 
+# With target=monitor, we compile a repl that reports violations and
+# keeps running, and does not log calls to imported actions unless
+# asked to. This is for checking recorded or live traffic against the
+# specification.
+
+monitor_mode = False
+
 def main():
     main_int(False)
 
@@ -5158,6 +5999,11 @@ def main_int(is_ivyc):
         target.set('repl')
         global emit_main
         emit_main = False
+
+    if target.get() == 'monitor':
+        target.set('repl')
+        global monitor_mode
+        monitor_mode = True
         
     with iu.ErrorPrinter():
         if len(sys.argv) == 2 and ic.get_file_version(sys.argv[1]) >= [2]:
@@ -5402,6 +6248,7 @@ hash_h = """
 
 #include <string>
 #include <vector>
+#include <map>
 #include <iterator>
 #include <fstream>
 
@@ -5484,6 +6331,19 @@ namespace hash_space {
         }
     };
 
+    template <typename K, typename V>
+        class hash<std::map<K,V> > {
+    public:
+        size_t operator()(const std::map<K,V> &p) const {
+            hash<K> hk;
+            hash<V> hv;
+            size_t res = 0;
+            for (typename std::map<K,V>::const_iterator it = p.begin(), en = p.end(); it != en; ++it)
+                res += hk(it->first) + hv(it->second);
+            return res;
+        }
+    };
+
     template <class T>
         class hash<std::pair<T *, T *> > {
     public:
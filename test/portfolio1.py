@@ -0,0 +1,40 @@
+import random
+import z3
+from ivy import ivy_solver as slv
+
+# A random 3-SAT problem near the threshold, so that the search
+# depends on the random seed.
+
+random.seed(7)
+xs = [z3.Bool('x{}'.format(i)) for i in range(120)]
+clauses = [z3.Or([x if random.randint(0,1) else z3.Not(x) for x in random.sample(xs,3)])
+           for k in range(510)]
+
+# Check that two seeds set on a solver that has already been checked
+# give different searches. Otherwise the portfolio races N copies of
+# the same search.
+
+def run(seed):
+    s = z3.Solver()
+    s.add(clauses)
+    s.check()
+    slv.set_solver_seed(s,seed)
+    s.add(z3.Or(xs[0],xs[1]))
+    res = s.check()
+    st = s.statistics()
+    return res,[st.get_key_value(k) for k in ['conflicts','decisions'] if k in st.keys()]
+
+res0,stats0 = run(0)
+res1,stats1 = run(1)
+print res0,stats0
+print res1,stats1
+assert res0 == res1
+assert stats0 != stats1,"seeds 0 and 1 gave the same search"
+
+# Check that the portfolio agrees with a single solver.
+
+s = z3.Solver()
+s.add(clauses)
+s.check()
+s.add(z3.Or(xs[0],xs[1]))
+assert slv.portfolio_check(s,None,3) == res0
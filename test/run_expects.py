@@ -50,6 +50,10 @@ checks = [
           ['oddeven4','OK'],
           ['learning_switch1','trace=true','learning_switch1.ivy: line 37:'],
           ['ded1','OK'],
+          ['bmc1','BMC with bound 3 found a counter-example'],
+          ['bmc1','incremental_bmc=true','BMC with bound 3 found a counter-example'],
+          ['bmc2','Checking invariants at depth 5[\s\S]*BOUNDED'],
+          ['bmc2','incremental_bmc=true','Checking invariants at depth 5[\s\S]*BOUNDED'],
       ]
     ],
     ['../doc/examples/testing',
@@ -123,6 +127,20 @@ tests = [
          ['token_ring','isolate=iso_n','test_completed'],
          ['token_ring','isolate=iso_pt','test_completed'],
       ]
+     ],
+    ['../doc/examples/quic',
+      [
+         ['quic_serdes_random_test','test_completed'],
+      ]
+     ],
+    ['.',
+      [
+         ['interval_set1','test_completed'],
+         ['interval_set2','cannot decode an infinite value'],
+         ['segmented_array1','test_completed'],
+         ['relation_quant1','test_completed'],
+         ['sparse_relation1','test_completed'],
+      ]
      ]
 ]
 
@@ -134,6 +152,8 @@ repls = [
          ['account',None],
          ['account2',None],
          ['account3',None],
+         ['account','account_binary_expect'],
+         ['helloworld','helloworld_socket_expect'],
          ['leader_election_ring_repl',None],
          ['udp_test','isolate=iso_impl',None],
          ['udp_test2','isolate=iso_impl',None],